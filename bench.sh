@@ -0,0 +1,19 @@
+#!/bin/bash
+###
+#   Publish benchmark - starts a throw away mosquitto on loopback, runs temperusb
+#   against it with simulated devices and leaves the JSON results in bench_output.json
+#
+#   ./bench.sh [cycles] [extra temperusb options, eg -p 0:Kitchen -p 1:Kitchen -p 2:Garage]
+###
+CYCLES=${1:-10000}
+shift
+PORT=18830
+TEMPERUSB=./dist/Debug/GNU-Linux/temperusb_c
+
+mosquitto -p $PORT > /dev/null 2>&1 &
+BROKER=$!
+trap "kill $BROKER" EXIT
+sleep 1
+
+$TEMPERUSB -S -h 127.0.0.1 -m $PORT -t TEMPERBENCH -B $CYCLES "$@" > bench_output.json
+cat bench_output.json
@@ -17,8 +17,13 @@
  * 14-Dec-2015  - still messing around with Git and AWS Code Commit
  * 16-Dec-2015  - still messing around with Git and AWS Code Commit
  * 26-Jun-2020  - pulling out INI file stuff, adding mDNS
+ * 18-Oct-2026  - multiple probes, grouped by location, with rolling aggregates
+ * 18-Oct-2026  - simulated device and a publish benchmark (-S, -B)
+ * 18-Oct-2026  - on demand reads via <topic>/<deviceNum>/read
+ * 18-Oct-2026  - adaptive read interval (-A)
+ * 18-Oct-2026  - device registry keyed by USB port path, reopen on read failure
  */
-#define _POSIX_SOURCE
+#define _POSIX_C_SOURCE 200809L
 
 #include <stdlib.h>
 #include <stdio.h>              /* String function definitions */
@@ -28,13 +33,18 @@
 #include <errno.h>              /* Error number definitions */
 #include <termios.h>            /* POSIX terminal control definitions */
 #include <time.h>
+#include <math.h>
 #include <signal.h>
 #include <getopt.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/resource.h>
 
 #include <usb.h>
 
 #include "temperusb.h"
 #include <libmqttrv.h>
+#include <mosquitto.h>
 #include <log4c.h>
 //#include <libiniparser_pmc.h>
 
@@ -76,9 +86,24 @@ static  int     debugValue = 5;
 static  char    mqttHost[ 1024 ];
 static  int     deviceNum = 1;
 static  char    location[ 1024 ];
+static  int     publishAggregates = FALSE;
+static  int     simulateDevices = FALSE;
+static  int     benchmarkMessages = 0;
+static  char    registryFile[ 1024 ] = "/var/tmp/temperusb.registry";
+
+//
+//      minReadSpacing - on demand reads never hit the bus closer together than this
+static  double  minReadSpacing = 0.5;
 
 static  struct  mosquitto   *aMosquittoInstance;
 
+//
+//  Our own connection for everything we subscribe to - libmqttrv's connection and its
+//  callbacks are left entirely alone
+static  struct  mosquitto   *mqttListener;
+static  int     listenToOwnTopics = FALSE;      // benchmark - the broker echoes us back
+static  int     listenerSubacks = 0;
+
 
 
 
@@ -87,6 +112,7 @@ static  struct  mosquitto   *aMosquittoInstance;
 #define VENDOR_ID   0x1130
 #define PRODUCT_ID  0x660c
 #define USB_TIMEOUT 1000                /* milliseconds */
+#define SYSFS_USB_DEVICES   "/sys/bus/usb/devices"
 
 
 struct Temper {
@@ -94,13 +120,413 @@ struct Temper {
         usb_dev_handle      *handle;
         int                 debug;
         int                 timeout;
+        int                 simulated;          // no USB - made up readings for testing
+        double              simPhase;
 };
 
 
+//
+//  Probes - each -p option adds one TemperUSB device to read. Probes that share a
+//  location tag are aggregated together. With no -p we read device 0 as before.
+#define MAX_PROBES      8
+#define MAX_LOCATIONS   MAX_PROBES
+
+typedef struct Probe {
+        int                 usbIndex;           // Nth TemperUSB device in the registry
+        int                 id;                 // deviceNum we publish with
+        char                portPath[ 64 ];     // eg "2-1.3" - from -p or the registry
+        int                 pinned;             // -p <port> - never follow the device elsewhere
+        char                location[ 128 ];
+        char                readTopic[ 256 ];   // publish anything here to get a fresh reading
+        Temper              *t;
+} Probe;
+
+static  Probe   probes[ MAX_PROBES ];
+static  int     numProbes = 0;
+
+
+//
+//  Device registry - the TemperUSB devices we've seen, keyed by the physical port they're
+//  plugged into. Enumeration order changes across reboots and replugs, the port doesn't,
+//  so -p <N> means the Nth device in here. If <N> is moved to another port it follows the
+//  device there; -p <port> stays on that port. It lives in registryFile, one line per device:
+//      <port path> <hex of the TemperGetOtherStuff reply, checked every time it's opened>
+#define MAX_REGISTRY    16
+#define IDENTITY_BYTES  32
+
+typedef struct RegistryEntry {
+        char                portPath[ 64 ];
+        char                identity[ (IDENTITY_BYTES * 2) + 1 ];
+} RegistryEntry;
+
+static  RegistryEntry   registry[ MAX_REGISTRY ];
+static  int             registrySize = 0;
+
+
+//
+//  Rolling aggregates - one per location. Every sample is pushed into a fixed window;
+//  the sum and sum of squares give mean and stddev, and a pair of monotonic queues
+//  give min and max, so each sample costs O(1) (amortized) no matter the window size.
+#define AGG_WINDOW      32                  // samples kept per location
+#define TREND_WINDOW    8                   // scheduled cycle means kept per location
+
+typedef struct MonoQueue {
+        double              value[ AGG_WINDOW ];
+        long                seq[ AGG_WINDOW ];
+        int                 head;
+        int                 count;
+} MonoQueue;
+
+typedef struct LocationAgg {
+        char                location[ 128 ];
+        int                 numProbes;
+
+        double              window[ AGG_WINDOW ];
+        int                 head;
+        int                 count;
+        long                seq;
+        double              sum;
+        double              sumSq;
+        MonoQueue           minQ;
+        MonoQueue           maxQ;
+
+        //
+        //  Per read cycle - spread between probes and the rate of change of the cycle mean
+        int                 cycleSamples;
+        double              cycleSum;
+        double              cycleMin;
+        double              cycleMax;
+        double              lastCycleMean;
+        double              lastCycleTime;
+        int                 haveLastCycle;
+        double              spread;
+        double              ratePerMin;         // degrees F per minute, smoothed
+
+        //
+        //  Cycle means from the last few scheduled reads, and when they were taken - how
+        //  much the location itself has been jumping around, as opposed to how far apart
+        //  its probes are. A steady drift is the rate's job, so it's fitted out.
+        double              trend[ TREND_WINDOW ];
+        double              trendTime[ TREND_WINDOW ];
+        int                 trendHead;
+        int                 trendCount;
+} LocationAgg;
+
+static  LocationAgg     aggregates[ MAX_LOCATIONS ];
+static  int             numAggregates = 0;
+
+#define RATE_SMOOTHING  0.3                 // EWMA weight given to the newest rate
+
+
+//
+//  Benchmark (-B) - every publish records its sample time and size; we subscribe to our
+//  own topics so the broker echoes each message back. The latency is sample to echo at
+//  this client - a round trip through the broker, not the time the broker received it.
+//  While benchmarking each payload is tagged with the run and its sequence number, so a
+//  dropped message or a straggler from the last run can't throw the pairing off.
+typedef struct Benchmark {
+        int                 active;
+        int                 run;
+        double              sampleTime;         // when the current reading was taken
+        long                published;
+        long                bytesOnWire;        // untagged - what production would send
+        long                tagBytes;           // what the benchmark tags added on top
+        long                received;
+        long                discarded;          // from an earlier run, or unrecognised
+        double              *sentAt;            // indexed by sequence number
+        double              *latency;           // indexed by receive order
+        long                capacity;
+        pthread_mutex_t     lock;
+} Benchmark;
+
+static  Benchmark   bench = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+
+//
+//  On demand reads - requests arrive on the MQTT network thread and wake up the main
+//  loop. A request that lands while a read is in flight is answered by that read if its
+//  probe hasn't been sampled yet; otherwise it waits for the next read. Any number of
+//  requests that arrive before we're allowed to read again become one read.
+typedef struct ReadRequests {
+        int                 pending;
+        int                 inFlight;
+        int                 sampled[ MAX_PROBES ];  // this read has started on probe N
+        double              lastReadTime;
+        long                received;
+        long                coalesced;
+        pthread_mutex_t     lock;
+        pthread_cond_t      cond;
+} ReadRequests;
+
+static  ReadRequests    requests = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+
+//
+//  Adaptive read interval (-A) - read slowly while things are stable, halve the interval
+//  when any location starts moving fast, and only back off again once it has been calm
+//  for a while. "Calm" is well below "fast" so we don't flap around the threshold. Only
+//  scheduled reads drive it - on demand reads come too close together to judge a rate.
+#define ADAPT_CALM_SECONDS      300.0       // calm this long before we slow down
+#define ADAPT_BACKOFF           1.5         // interval multiplier when slowing down
+#define ADAPT_CALM_FRACTION     0.25        // calm means below this fraction of fast
+
+typedef struct AdaptiveSchedule {
+        int                 enabled;
+        double              minInterval;        // seconds
+        double              maxInterval;
+        double              fastRate;           // degrees F per minute
+        double              fastStddev;         // degrees F, scatter of recent cycle means about their trend
+        double              interval;
+        double              calmSince;          // 0 - not calm
+} AdaptiveSchedule;
+
+static  AdaptiveSchedule    schedule = { FALSE, 10.0, 600.0, 0.5, 1.0, 0.0, 0.0 };
+
+
+
+
+// -------------------------------------------------------------------------------------
+static
+double  monotonicSeconds (void)
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + (ts.tv_nsec / 1.0e9);
+}
+
+// -------------------------------------------------------------------------------------
+static
+void    benchmarkNotePublish (char *topic, char *payload, int size)
+{
+    long    remaining;
+    int     header, length;
+    long    seq;
+    char    *brace;
+
+    if (!bench.active) {
+        return;
+    }
+
+    //
+    //  Size the real message - the tag below is benchmark only and is counted on its own
+    length = strlen( payload );
+
+    pthread_mutex_lock( &bench.lock );
+    seq = bench.published;
+    if (seq < bench.capacity) {
+        bench.sentAt[ seq ] = bench.sampleTime;
+    }
+    bench.published += 1;
+
+    //
+    //  Tag it - { ...,"benchRun":R,"benchSeq":N}
+    brace = strrchr( payload, '}' );
+    if (brace) {
+        snprintf( brace, size - (brace - payload), ",\"benchRun\":%d,\"benchSeq\":%ld}", bench.run, seq );
+    }
+    bench.tagBytes += strlen( payload ) - length;
+
+    //
+    //  QoS 0 PUBLISH: fixed header byte + remaining length (1-4 bytes), then the
+    //  2 byte topic length, the topic and the payload
+    remaining = 2 + strlen( topic ) + length;
+    header = 1 + (remaining < 128 ? 1 : remaining < 16384 ? 2 : remaining < 2097152 ? 3 : 4);
+    bench.bytesOnWire += header + remaining;
+    pthread_mutex_unlock( &bench.lock );
+}
+
+// -------------------------------------------------------------------------------------
+static
+void    benchmarkOnMessage (struct mosquitto *mosq, void *userData, const struct mosquitto_message *msg)
+{
+    double  now = monotonicSeconds();
+    char    payload[ 1024 ];
+    char    *tag;
+    int     length, run;
+    long    seq;
+
+    if (!bench.active) {
+        return;
+    }
+
+    //
+    //  The payload isn't guaranteed to be NUL terminated - copy it before we go looking
+    length = (msg->payloadlen < (int) sizeof payload - 1) ? msg->payloadlen : (int) sizeof payload - 1;
+    memcpy( payload, msg->payload, length );
+    payload[ length ] = '\0';
+
+    tag = strstr( payload, "\"benchRun\":" );
+
+    pthread_mutex_lock( &bench.lock );
+    if (tag && sscanf( tag, "\"benchRun\":%d,\"benchSeq\":%ld", &run, &seq ) == 2 &&
+        run == bench.run && seq >= 0 && seq < bench.published && seq < bench.capacity &&
+        bench.received < bench.capacity) {
+            bench.latency[ bench.received ] = now - bench.sentAt[ seq ];
+            bench.received += 1;
+    } else {
+        bench.discarded += 1;
+    }
+    pthread_mutex_unlock( &bench.lock );
+}
+
+// -------------------------------------------------------------------------------------
+static
+void    readRequestReceived (int probe, char *topic)
+{
+    pthread_mutex_lock( &requests.lock );
+    requests.received += 1;
+
+    //
+    //  The read in flight hasn't got to this probe yet - its reading will be fresh enough
+    if (requests.inFlight && !requests.sampled[ probe ]) {
+        requests.coalesced += 1;
+        if (debug) {
+            Logger_LogDebug( "Read request on [%s] answered by the read in flight - %ld coalesced so far\n", topic, requests.coalesced );
+        }
+        pthread_mutex_unlock( &requests.lock );
+        return;
+    }
+
+    if (requests.pending) {
+        requests.coalesced += 1;
+        if (debug) {
+            Logger_LogDebug( "Read request on [%s] coalesced - %ld so far\n", topic, requests.coalesced );
+        }
+    }
+
+    requests.pending = TRUE;
+    pthread_cond_signal( &requests.cond );
+    pthread_mutex_unlock( &requests.lock );
+}
+
+// -------------------------------------------------------------------------------------
+static
+void    readProbeStarting (int probe)
+{
+    pthread_mutex_lock( &requests.lock );
+    requests.sampled[ probe ] = TRUE;
+    pthread_mutex_unlock( &requests.lock );
+}
+
+// -------------------------------------------------------------------------------------
+static
+void    mqttOnMessage (struct mosquitto *mosq, void *userData, const struct mosquitto_message *msg)
+{
+    int     i;
+
+    for (i = 0; i < numProbes; i += 1) {
+        if (probes[ i ].readTopic[ 0 ] != '\0' && strcmp( msg->topic, probes[ i ].readTopic ) == 0) {
+            readRequestReceived( i, msg->topic );
+            return;
+        }
+    }
+
+    benchmarkOnMessage( mosq, userData, msg );
+}
+
+// -------------------------------------------------------------------------------------
+static
+void    mqttSubscribeReadTopics (struct mosquitto *mosq)
+{
+    int     i, rc;
+
+    for (i = 0; i < numProbes; i += 1) {
+        if (probes[ i ].readTopic[ 0 ] == '\0') {
+            continue;                       // not listening for read requests (yet)
+        }
+
+        rc = mosquitto_subscribe( mosq, NULL, probes[ i ].readTopic, 0 );
+        if (rc != MOSQ_ERR_SUCCESS) {
+            Logger_LogError( "Could not subscribe to [%s]: %s - on demand reads disabled\n", probes[ i ].readTopic, mosquitto_strerror( rc ) );
+        } else {
+            Logger_LogInfo( "Listening for read requests on [%s]\n", probes[ i ].readTopic );
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------
+static
+void    mqttOnConnect (struct mosquitto *mosq, void *userData, int rc)
+{
+    char    topic[ 1024 ];
+
+    //
+    //  A broker restart or a clean session reconnect forgets our subscriptions
+    if (rc != 0) {
+        Logger_LogError( "MQTT listener connect failed: %s - on demand reads unavailable until we reconnect\n", mosquitto_connack_string( rc ) );
+        return;
+    }
+
+    mqttSubscribeReadTopics( mosq );
+
+    if (listenToOwnTopics) {
+        mosquitto_subscribe( mosq, NULL, mqttTopic, 0 );
+        snprintf( topic, sizeof topic, "%s/aggregate", mqttTopic );
+        mosquitto_subscribe( mosq, NULL, topic, 0 );
+    }
+}
+
+// -------------------------------------------------------------------------------------
+static
+void    mqttOnSubscribe (struct mosquitto *mosq, void *userData, int mid, int qosCount, const int *grantedQos)
+{
+    pthread_mutex_lock( &requests.lock );
+    listenerSubacks += 1;
+    pthread_mutex_unlock( &requests.lock );
+}
+
+// -------------------------------------------------------------------------------------
+//
+//  We don't know how libmqttrv drives its connection or what callbacks it relies on, so
+//  rather than hang ours off it we open a second connection of our own to the same broker.
+//  libmosquitto's threaded loop reconnects it, and mqttOnConnect subscribes every time.
+static
+void    mqttStartListening (void)
+{
+    int     rc;
+
+    if (mqttListener) {
+        return;
+    }
+
+    mqttListener = mosquitto_new( NULL, true, NULL );
+    if (!mqttListener) {
+        Logger_LogFatal( "Could not create the MQTT listener\n" );
+        exit( 1 );
+    }
+
+    mosquitto_message_callback_set( mqttListener, mqttOnMessage );
+    mosquitto_connect_callback_set( mqttListener, mqttOnConnect );
+    mosquitto_subscribe_callback_set( mqttListener, mqttOnSubscribe );
+
+    rc = mosquitto_connect_async( mqttListener, mqttHost, mqttPort, 60 );
+    if (rc != MOSQ_ERR_SUCCESS) {
+        Logger_LogError( "MQTT listener could not connect to [%s:%d]: %s - will keep trying\n", mqttHost, mqttPort, mosquitto_strerror( rc ) );
+    }
+
+    rc = mosquitto_loop_start( mqttListener );
+    if (rc != MOSQ_ERR_SUCCESS) {
+        Logger_LogFatal( "Could not start the MQTT listener loop: %s\n", mosquitto_strerror( rc ) );
+        exit( 1 );
+    }
+}
+
+// -------------------------------------------------------------------------------------
+static
+void    mqttStopListening (void)
+{
+    if (mqttListener) {
+        mosquitto_disconnect( mqttListener );
+        mosquitto_loop_stop( mqttListener, false );
+        mosquitto_destroy( mqttListener );
+        mqttListener = NULL;
+    }
+}
 
 // -------------------------------------------------------------------------------------
 static
-void    mqttPublish (double deviceTemp)
+void    mqttPublish (int id, char *probeLocation, double deviceTemp)
 {
     char            timeStr[ 50 ];
     time_t          t;
@@ -133,18 +559,259 @@ void    mqttPublish (double deviceTemp)
     memset( buffer, '\0', sizeof buffer );
     int length = snprintf( buffer, sizeof buffer, jsonTemplate,
                 mqttTopic,
-                deviceNum,
+                id,
                 timeStr,
-                location,
+                probeLocation,
                 deviceTemp
             );
 
-    
+
+    benchmarkNotePublish( mqttTopic, buffer, sizeof buffer );
     if (MQTT_Publish( aMosquittoInstance, mqttTopic, buffer, 0 ) != 0) {
-       exit( 1 );   
+       exit( 1 );
+    }
+}
+
+// -------------------------------------------------------------------------------------
+static
+double  aggregateStddev (LocationAgg *agg)
+{
+    double  mean, variance;
+
+    if (agg->count == 0) {
+        return 0.0;
+    }
+
+    mean = agg->sum / agg->count;
+    variance = (agg->sumSq / agg->count) - (mean * mean);
+    if (variance < 0.0) {
+        variance = 0.0;                     // rounding
+    }
+    return sqrt( variance );
+}
+
+// -------------------------------------------------------------------------------------
+static
+void    mqttPublishAggregate (LocationAgg *agg)
+{
+    char            timeStr[ 50 ];
+    time_t          t;
+    struct tm       *tmp;
+    char            topic[ 1024 ];
+    char            buffer[ 1024 ];
+    double          mean;
+
+    if (!MQTT_Connected) {
+        Logger_LogDebug( "TEMPER: Error: Attempt to publish aggregate using MQTT. Broker not connected\n" );
+        return;
+    }
+
+    t = time( NULL );
+    tmp = localtime( &t );
+    strftime( timeStr, sizeof timeStr, "%FT%T%z", tmp );
+
+    mean = agg->sum / agg->count;
+
+    static  char    *jsonTemplate = "{ "
+    "\"topic\":\"%s\","
+    "\"version\":\"1.0\","
+    "\"dateTime\":\"%s\","
+    "\"location\":\"%s\","
+    "\"probes\":%d,"
+    "\"samples\":%d,"
+    "\"min\":%.1f,"
+    "\"max\":%.1f,"
+    "\"mean\":%.2f,"
+    "\"stddev\":%.2f,"
+    "\"spread\":%.1f,"
+    "\"ratePerMin\":%.3f}";
+
+    snprintf( topic, sizeof topic, "%s/aggregate", mqttTopic );
+    snprintf( buffer, sizeof buffer, jsonTemplate,
+                topic,
+                timeStr,
+                agg->location,
+                agg->numProbes,
+                agg->count,
+                agg->minQ.value[ agg->minQ.head ],
+                agg->maxQ.value[ agg->maxQ.head ],
+                mean,
+                aggregateStddev( agg ),
+                agg->spread,
+                agg->ratePerMin
+            );
+
+    benchmarkNotePublish( topic, buffer, sizeof buffer );
+    if (MQTT_Publish( aMosquittoInstance, topic, buffer, 0 ) != 0) {
+       exit( 1 );
+    }
+}
+
+// -------------------------------------------------------------------------------------
+static
+void    monoQueuePush (MonoQueue *q, double value, long seq, int keepMax)
+{
+    //
+    //  Drop entries that have slid out of the window, then anything at the back that
+    //  the new value dominates. What's left is sorted, so the head is the min (or max).
+    while (q->count > 0 && q->seq[ q->head ] <= seq - AGG_WINDOW) {
+        q->head = (q->head + 1) % AGG_WINDOW;
+        q->count -= 1;
+    }
+
+    while (q->count > 0) {
+        int back = (q->head + q->count - 1) % AGG_WINDOW;
+
+        if (keepMax ? (q->value[ back ] > value) : (q->value[ back ] < value)) {
+            break;
+        }
+        q->count -= 1;
+    }
+
+    int slot = (q->head + q->count) % AGG_WINDOW;
+    q->value[ slot ] = value;
+    q->seq[ slot ] = seq;
+    q->count += 1;
+}
+
+// -------------------------------------------------------------------------------------
+static
+LocationAgg *aggregateFind (char *probeLocation)
+{
+    int i;
+
+    for (i = 0; i < numAggregates; i += 1) {
+        if (strcmp( aggregates[ i ].location, probeLocation ) == 0) {
+            return &aggregates[ i ];
+        }
+    }
+
+    if (numAggregates >= MAX_LOCATIONS) {
+        return NULL;
+    }
+
+    LocationAgg *agg = &aggregates[ numAggregates++ ];
+    memset( agg, 0, sizeof *agg );
+    strncpy( agg->location, probeLocation, sizeof agg->location - 1 );
+    return agg;
+}
+
+// -------------------------------------------------------------------------------------
+static
+void    aggregateAddSample (LocationAgg *agg, double tempF)
+{
+    if (agg->count == AGG_WINDOW) {
+        double  oldest = agg->window[ agg->head ];
+
+        agg->sum -= oldest;
+        agg->sumSq -= oldest * oldest;
+        agg->head = (agg->head + 1) % AGG_WINDOW;
+        agg->count -= 1;
+    }
+
+    agg->window[ (agg->head + agg->count) % AGG_WINDOW ] = tempF;
+    agg->count += 1;
+    agg->sum += tempF;
+    agg->sumSq += tempF * tempF;
+
+    agg->seq += 1;
+    monoQueuePush( &agg->minQ, tempF, agg->seq, FALSE );
+    monoQueuePush( &agg->maxQ, tempF, agg->seq, TRUE );
+
+    if (agg->cycleSamples == 0 || tempF < agg->cycleMin) {
+        agg->cycleMin = tempF;
+    }
+    if (agg->cycleSamples == 0 || tempF > agg->cycleMax) {
+        agg->cycleMax = tempF;
     }
+    agg->cycleSum += tempF;
+    agg->cycleSamples += 1;
 }
 
+// -------------------------------------------------------------------------------------
+static
+void    aggregateFinishCycle (LocationAgg *agg, double now, int scheduled)
+{
+    double  cycleMean;
+
+    if (agg->cycleSamples == 0) {
+        return;
+    }
+
+    cycleMean = agg->cycleSum / agg->cycleSamples;
+    agg->spread = agg->cycleMax - agg->cycleMin;
+    agg->cycleSamples = 0;
+    agg->cycleSum = 0.0;
+
+    //
+    //  On demand reads can be a fraction of a second apart - one LSB over half a second
+    //  looks like a furnace fire. Rate and trend only move on scheduled reads.
+    if (!scheduled) {
+        return;
+    }
+
+    if (agg->haveLastCycle && now > agg->lastCycleTime) {
+        double  rate = (cycleMean - agg->lastCycleMean) * 60.0 / (now - agg->lastCycleTime);
+
+        agg->ratePerMin = (RATE_SMOOTHING * rate) + ((1.0 - RATE_SMOOTHING) * agg->ratePerMin);
+    }
+
+    agg->lastCycleMean = cycleMean;
+    agg->lastCycleTime = now;
+    agg->haveLastCycle = TRUE;
+
+    if (agg->trendCount == TREND_WINDOW) {
+        agg->trendHead = (agg->trendHead + 1) % TREND_WINDOW;
+        agg->trendCount -= 1;
+    }
+    agg->trend[ (agg->trendHead + agg->trendCount) % TREND_WINDOW ] = cycleMean;
+    agg->trendTime[ (agg->trendHead + agg->trendCount) % TREND_WINDOW ] = now;
+    agg->trendCount += 1;
+}
+
+// -------------------------------------------------------------------------------------
+//
+//  Stddev of the cycle means about a least squares line through them in time. Left
+//  around their plain mean a slow drift grows with the time the window spans - at a
+//  long interval it would look like noise and keep halving the interval it came from.
+static
+double  aggregateTrendStddev (LocationAgg *agg)
+{
+    double  meanT = 0.0, meanV = 0.0;
+    double  sTT = 0.0, sTV = 0.0, slope = 0.0;
+    double  residual, variance = 0.0;
+    int     i, k;
+
+    if (agg->trendCount < 3) {
+        return 0.0;                         // two points always sit on a line
+    }
+
+    for (i = 0; i < agg->trendCount; i += 1) {
+        k = (agg->trendHead + i) % TREND_WINDOW;
+        meanT += agg->trendTime[ k ];
+        meanV += agg->trend[ k ];
+    }
+    meanT /= agg->trendCount;
+    meanV /= agg->trendCount;
+
+    for (i = 0; i < agg->trendCount; i += 1) {
+        k = (agg->trendHead + i) % TREND_WINDOW;
+        sTT += (agg->trendTime[ k ] - meanT) * (agg->trendTime[ k ] - meanT);
+        sTV += (agg->trendTime[ k ] - meanT) * (agg->trend[ k ] - meanV);
+    }
+    if (sTT > 0.0) {
+        slope = sTV / sTT;
+    }
+
+    for (i = 0; i < agg->trendCount; i += 1) {
+        k = (agg->trendHead + i) % TREND_WINDOW;
+        residual = agg->trend[ k ] - (meanV + slope * (agg->trendTime[ k ] - meanT));
+        variance += residual * residual;
+    }
+    return sqrt( variance / agg->trendCount );
+}
+
+
 // ------------------------------------------------------------------
 void     terminationHandler (int signalValue)
 {
@@ -166,6 +833,19 @@ void    help (void)
     puts( "    -h <server>          send MQTT data to this MQTT server" );
     puts( "    -m <mqtt port num>   use this port number for MQTT (eg 1883)" );
     puts( "    -t <topic>           use <topic> as the MQTT topic string" );
+    puts( "    -p <N>[:<Location>]  read the Nth registered TemperUSB device, may be repeated (default 0)" );
+    puts( "    -p <port>[:<Location>]  read the TemperUSB plugged into USB port <port>, eg 2-1.3" );
+    puts( "    -D <file>            device registry (default /var/tmp/temperusb.registry)" );
+    puts( "    -a                   publish rolling min/max/mean/spread/rate per location" );
+    puts( "    -S                   simulate the devices - no USB needed" );
+    puts( "    -B <readings>        benchmark publishing <readings> cycles, print JSON results and exit" );
+    puts( "    -s <milliseconds>    minimum time between on demand reads (default 500)" );
+    puts( "    -A <min>:<max>[:<F/min>[:<F>]]  adapt the reading interval between <min> and <max> seconds," );
+    puts( "                         reading faster when temperatures change faster than <F/min> (default 0.5)" );
+    puts( "                         or recent readings scatter more than <F> stddev about their trend (default 1.0)" );
+    puts( "" );
+    puts( "Publish anything to <topic>/<ID>/read to read the devices right away. Every device is" );
+    puts( "read, whichever <ID> is asked for, so the per location aggregates stay consistent." );
     
     
     //puts( "" );
@@ -275,6 +955,122 @@ Temper *TemperCreateFromDeviceNumber(int deviceNum, int timeout, int debug)
     return NULL;
 }
 
+// -----------------------------------------------------------------------------
+static int readSysfsInt(char *deviceName, char *attribute, int *value)
+{
+    char    path[ 512 ];
+    FILE    *fp;
+    int     ok;
+
+    snprintf( path, sizeof path, "%s/%s/%s", SYSFS_USB_DEVICES, deviceName, attribute );
+    fp = fopen( path, "r" );
+    if (!fp) {
+        return -1;
+    }
+
+    ok = (fscanf( fp, "%d", value ) == 1);
+    fclose( fp );
+    return ok ? 0 : -1;
+}
+
+// -----------------------------------------------------------------------------
+//
+//  libusb 0.1 only knows bus and device numbers, and the device number changes every
+//  time the device is plugged in. sysfs names each device after its port - eg "2-1.3"
+//  is bus 2, port 1, port 3 - so look for the entry with our bus and device numbers.
+int TemperGetPortPath(struct usb_device *dev, char *portPath, int length)
+{
+    DIR             *dir;
+    struct dirent   *entry;
+    int             busnum, devnum;
+    int             found = -1;
+
+    dir = opendir( SYSFS_USB_DEVICES );
+    if (!dir) {
+        return -1;
+    }
+
+    while ((entry = readdir( dir )) != NULL) {
+        //
+        //  Interfaces ("2-1.3:1.0") and the "." entries aren't devices
+        if (entry->d_name[ 0 ] == '.' || strchr( entry->d_name, ':' )) {
+            continue;
+        }
+
+        if (readSysfsInt( entry->d_name, "busnum", &busnum ) == 0 &&
+            readSysfsInt( entry->d_name, "devnum", &devnum ) == 0 &&
+            busnum == atoi( dev->bus->dirname ) && devnum == dev->devnum) {
+                strncpy( portPath, entry->d_name, length - 1 );
+                portPath[ length - 1 ] = '\0';
+                found = 0;
+                break;
+        }
+    }
+
+    closedir( dir );
+    return found;
+}
+
+// -----------------------------------------------------------------------------
+//
+//  Straight to the device on this port - no walking every bus and counting devices.
+Temper *TemperCreateFromPortPath(char *portPath, int timeout, int debug)
+{
+    struct usb_bus      *bus;
+    struct usb_device   *dev;
+    int                 busnum, devnum;
+    int                 attempt;
+
+    if (readSysfsInt( portPath, "busnum", &busnum ) < 0 || readSysfsInt( portPath, "devnum", &devnum ) < 0) {
+        if (debug) {
+            Logger_LogDebug( "Nothing plugged into port %s\n", portPath );
+        }
+        return NULL;
+    }
+
+    //
+    //  libusb's lists are a snapshot - if the device was replugged since, refresh once
+    for (attempt = 0; attempt < 2; attempt += 1) {
+        for (bus = usb_get_busses(); bus; bus = bus->next) {
+            if (atoi( bus->dirname ) != busnum) {
+                continue;
+            }
+
+            for (dev = bus->devices; dev; dev = dev->next) {
+                if (dev->devnum == devnum) {
+                    if (dev->descriptor.idVendor != VENDOR_ID || dev->descriptor.idProduct != PRODUCT_ID) {
+                        Logger_LogWarning( "Port %s has a %04x:%04x, not a TemperUSB\n", portPath,
+                                dev->descriptor.idVendor, dev->descriptor.idProduct );
+                        return NULL;
+                    }
+                    if (debug) {
+                        Logger_LogDebug( "Found TemperUSB on port %s (bus %d device %d)\n", portPath, busnum, devnum );
+                    }
+                    return TemperCreate( dev, timeout, debug );
+                }
+            }
+        }
+
+        usb_find_busses();
+        usb_find_devices();
+    }
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+Temper *TemperCreateSimulated(int timeout, int debug)
+{
+    Temper  *t = NULL;
+
+    t = calloc( 1, sizeof( *t ) );
+    t->debug = debug;
+    t->timeout = timeout;
+    t->simulated = TRUE;
+    t->simPhase = (rand() % 628) / 100.0;
+    return t;
+}
+
 // ------------------------------------------------------------------------------------
 void TemperFree(Temper *t)
 {
@@ -282,81 +1078,418 @@ void TemperFree(Temper *t)
         if (t->handle) {
             usb_close(t->handle);
         }
-        free( t );
+        free( t );
+    }
+}
+
+// -----------------------------------------------------------------------------
+static int TemperSendCommand (Temper *t, int a, int b, int c, int d, int e, int f, int g, int h)
+{
+    unsigned char   buf[ 32 ];
+    int             ret;
+
+    memset( buf, 0, 32 );
+    buf[ 0 ] = a;
+    buf[ 1 ] = b;
+    buf[ 2 ] = c;
+    buf[ 3 ] = d;
+    buf[ 4 ] = e;
+    buf[ 5 ] = f;
+    buf[ 6 ] = g;
+    buf[ 7 ] = h;
+
+    ret = usb_control_msg(t->handle, 0x21, 9, 0x200, 0x01, (char *) buf, 32, t->timeout);
+    
+    if(ret != 32) {
+        Logger_LogError( "usb_control_msg failed\n" );
+        return -1;
+    }
+    
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+static int TemperGetData (Temper *t, char *buf, int len)
+{
+    int ret;
+
+    return usb_control_msg( t->handle, 0xa1, 1, 0x300, 0x01, (char *) buf, len, t->timeout );
+}
+
+// -----------------------------------------------------------------------------
+int TemperGetTemperatureInC(Temper *t, double *tempC)
+{
+    char buf[ 256 ];
+    int ret, temperature, i;
+
+    if (t->simulated) {
+        //
+        //  A slow swing around 20C with a little noise - close enough to a real room
+        t->simPhase += 0.01;
+        *tempC = 20.0 + (5.0 * sin( t->simPhase )) + ((rand() % 100) / 500.0);
+        return 0;
+    }
+
+    TemperSendCommand( t, 10, 11, 12, 13, 0, 0, 2, 0 );
+    TemperSendCommand( t, 0x54, 0, 0, 0, 0, 0, 0, 0 );
+    
+    for (i = 0; i < 7; i += 1) {
+        TemperSendCommand( t, 0, 0, 0, 0, 0, 0, 0, 0 );
+    }
+    
+    TemperSendCommand( t, 10, 11, 12, 13, 0, 0, 1, 0 );
+    
+    ret = TemperGetData( t, buf, 256 );
+    if (ret < 2) {
+        return -1;
+    }
+
+    temperature = (buf[ 1 ] & 0xFF) + (buf[ 0 ] << 8);
+    temperature += 1152;                    // calibration value
+    *tempC = temperature * (125.0 / 32000.0);
+    
+    // printf( "............. %0.2f\n", *tempC );
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+int TemperGetOtherStuff(Temper *t, char *buf, int length)
+{
+    if (t->simulated) {
+        return 0;
+    }
+
+    TemperSendCommand( t, 10, 11, 12, 13, 0, 0, 2, 0 );
+    TemperSendCommand( t, 0x52, 0, 0, 0, 0, 0, 0, 0 );
+    TemperSendCommand( t, 10, 11, 12, 13, 0, 0, 1, 0 );
+    return TemperGetData( t, buf, length );
+}
+
+
+// -----------------------------------------------------------------------------
+static
+void    registryLoad (void)
+{
+    FILE    *fp;
+    char    line[ 256 ];
+
+    registrySize = 0;
+    fp = fopen( registryFile, "r" );
+    if (!fp) {
+        return;                             // first run - a scan will fill it in
+    }
+
+    while (registrySize < MAX_REGISTRY && fgets( line, sizeof line, fp )) {
+        RegistryEntry   *entry = &registry[ registrySize ];
+
+        memset( entry, 0, sizeof *entry );
+        if (sscanf( line, "%63s %64s", entry->portPath, entry->identity ) >= 1 && entry->portPath[ 0 ] != '#') {
+            registrySize += 1;
+        }
+    }
+
+    fclose( fp );
+    Logger_LogInfo( "Device registry [%s] - %d devices\n", registryFile, registrySize );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    registrySave (void)
+{
+    FILE    *fp;
+    char    tmpFile[ sizeof registryFile + 8 ];
+    int     i, ok;
+
+    //
+    //  Write a new copy and rename it over the old one - a crash part way through must
+    //  never leave a truncated registry, or the next scan renumbers everything
+    snprintf( tmpFile, sizeof tmpFile, "%s.tmp", registryFile );
+    fp = fopen( tmpFile, "w" );
+    if (!fp) {
+        Logger_LogWarning( "Could not write device registry [%s]: %s\n", tmpFile, strerror( errno ) );
+        return;
+    }
+
+    fprintf( fp, "# TemperUSB devices by USB port - the Nth entry is -p N\n" );
+    for (i = 0; i < registrySize; i += 1) {
+        fprintf( fp, "%s %s\n", registry[ i ].portPath, registry[ i ].identity );
+    }
+
+    ok = (fflush( fp ) == 0 && fsync( fileno( fp ) ) == 0);
+    ok = (fclose( fp ) == 0) && ok;
+    if (!ok || rename( tmpFile, registryFile ) != 0) {
+        Logger_LogWarning( "Could not write device registry [%s]: %s\n", registryFile, strerror( errno ) );
+        remove( tmpFile );
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+int     registryFind (char *portPath)
+{
+    int     i;
+
+    for (i = 0; i < registrySize; i += 1) {
+        if (strcmp( registry[ i ].portPath, portPath ) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// -----------------------------------------------------------------------------
+//
+//  Is registry entry N spoken for by a probe other than this one?
+static
+int     registryClaimed (Probe *self, int n)
+{
+    int     i;
+
+    for (i = 0; i < numProbes; i += 1) {
+        Probe   *q = &probes[ i ];
+
+        if (q == self) {
+            continue;
+        }
+        if (q->portPath[ 0 ] != '\0' ? (strcmp( q->portPath, registry[ n ].portPath ) == 0) : (q->usbIndex == n)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// -----------------------------------------------------------------------------
+//
+//  Full up - hand out the slot of a port with nothing plugged into it that no probe asks
+//  for. The other entries keep their indexes, so nobody else's deviceNum moves.
+static
+int     registryReuse (char *portPath)
+{
+    int     i, busnum;
+
+    for (i = 0; i < registrySize; i += 1) {
+        if (readSysfsInt( registry[ i ].portPath, "busnum", &busnum ) == 0 || registryClaimed( NULL, i )) {
+            continue;
+        }
+
+        Logger_LogWarning( "Device registry is full - port %s is empty, device %d is now port %s\n",
+                registry[ i ].portPath, i, portPath );
+        return i;
+    }
+    return -1;
+}
+
+// -----------------------------------------------------------------------------
+static
+int     registryAdd (char *portPath)
+{
+    int     i = registryFind( portPath );
+
+    if (i >= 0) {
+        return i;
+    }
+
+    if (registrySize < MAX_REGISTRY) {
+        i = registrySize++;
+        Logger_LogInfo( "New TemperUSB on port %s - registered as device %d\n", portPath, i );
+    } else {
+        i = registryReuse( portPath );
+        if (i < 0) {
+            return -1;
+        }
     }
+
+    memset( &registry[ i ], 0, sizeof registry[ i ] );
+    strncpy( registry[ i ].portPath, portPath, sizeof registry[ i ].portPath - 1 );
+    registrySave();
+    return i;
 }
 
 // -----------------------------------------------------------------------------
-static int TemperSendCommand (Temper *t, int a, int b, int c, int d, int e, int f, int g, int h)
+//
+//  The slow path - walk every bus and register any TemperUSB we haven't seen before.
+static
+void    registryScan (void)
 {
-    unsigned char   buf[ 32 ];
-    int             ret;
+    struct usb_bus      *bus;
+    struct usb_device   *dev;
+    char                portPath[ 64 ];
 
-    memset( buf, 0, 32 );
-    buf[ 0 ] = a;
-    buf[ 1 ] = b;
-    buf[ 2 ] = c;
-    buf[ 3 ] = d;
-    buf[ 4 ] = e;
-    buf[ 5 ] = f;
-    buf[ 6 ] = g;
-    buf[ 7 ] = h;
+    usb_find_busses();
+    usb_find_devices();
 
-    ret = usb_control_msg(t->handle, 0x21, 9, 0x200, 0x01, (char *) buf, 32, t->timeout);
-    
-    if(ret != 32) {
-        Logger_LogError( "usb_control_msg failed\n" );
-        return -1;
+    for (bus = usb_get_busses(); bus; bus = bus->next) {
+        for (dev = bus->devices; dev; dev = dev->next) {
+            if (dev->descriptor.idVendor == VENDOR_ID && dev->descriptor.idProduct == PRODUCT_ID &&
+                TemperGetPortPath( dev, portPath, sizeof portPath ) == 0) {
+                    registryAdd( portPath );
+            }
+        }
     }
-    
-    return 0;
 }
 
 // -----------------------------------------------------------------------------
-static int TemperGetData (Temper *t, char *buf, int len)
+//
+//  Nothing on this probe's registered port - it's been moved. Take the newest present
+//  device no other probe wants and swap ports with its entry, so this probe keeps its
+//  index (and deviceNum) and the other entry is left holding the empty port.
+static
+int     rebindProbe (Probe *p)
 {
-    int ret;
+    RegistryEntry   swap;
+    int             j;
 
-    return usb_control_msg( t->handle, 0xa1, 1, 0x300, 0x01, (char *) buf, len, t->timeout );
+    for (j = registrySize - 1; j >= 0; j -= 1) {
+        if (j == p->usbIndex || registryClaimed( p, j )) {
+            continue;
+        }
+
+        p->t = TemperCreateFromPortPath( registry[ j ].portPath, USB_TIMEOUT, (debug ? 1 : 0 ) );
+        if (p->t) {
+            Logger_LogWarning( "Nothing on port %s - device %d now reads the TemperUSB on port %s\n",
+                    p->portPath, p->usbIndex, registry[ j ].portPath );
+
+            swap = registry[ p->usbIndex ];
+            strcpy( registry[ p->usbIndex ].portPath, registry[ j ].portPath );
+            strcpy( registry[ j ].portPath, swap.portPath );
+            registry[ j ].identity[ 0 ] = '\0';
+            registrySave();
+
+            strcpy( p->portPath, registry[ p->usbIndex ].portPath );
+            return TRUE;
+        }
+    }
+    return FALSE;
 }
 
 // -----------------------------------------------------------------------------
-int TemperGetTemperatureInC(Temper *t, double *tempC)
+static
+int     openProbe (Probe *p)
 {
-    char buf[ 256 ];
-    int ret, temperature, i;
+    char            buf[ 256 ];
+    char            identity[ sizeof registry[ 0 ].identity ];
+    RegistryEntry   *entry;
+    int             i, j, length;
+
+    if (simulateDevices) {
+        p->t = TemperCreateSimulated( USB_TIMEOUT, (debug ? 1 : 0 ) );
+        return (p->t != NULL);
+    }
 
-    TemperSendCommand( t, 10, 11, 12, 13, 0, 0, 2, 0 );
-    TemperSendCommand( t, 0x54, 0, 0, 0, 0, 0, 0, 0 );
-    
-    for (i = 0; i < 7; i += 1) {
-        TemperSendCommand( t, 0, 0, 0, 0, 0, 0, 0, 0 );
+    //
+    //  -p <N> - the Nth device we've ever registered. Only scan if we don't know it yet.
+    if (p->portPath[ 0 ] == '\0') {
+        if (p->usbIndex >= registrySize) {
+            registryScan();
+        }
+        if (p->usbIndex < registrySize) {
+            strncpy( p->portPath, registry[ p->usbIndex ].portPath, sizeof p->portPath - 1 );
+        }
     }
-    
-    TemperSendCommand( t, 10, 11, 12, 13, 0, 0, 1, 0 );
-    
-    ret = TemperGetData( t, buf, 256 );
-    if (ret < 2) {
-        return -1;
+
+    if (p->portPath[ 0 ] != '\0') {
+        p->t = TemperCreateFromPortPath( p->portPath, USB_TIMEOUT, (debug ? 1 : 0 ) );
+
+        //
+        //  Missed - rescan everything (registering anything new) and give the port one more go
+        if (!p->t) {
+            registryScan();
+            p->t = TemperCreateFromPortPath( p->portPath, USB_TIMEOUT, (debug ? 1 : 0 ) );
+        }
+
+        //
+        //  Still nothing - an explicit -p <port> means that port, but a registry index
+        //  (or the default device) follows the device to wherever it was plugged back in
+        if (!p->t && !p->pinned && p->usbIndex < registrySize &&
+            strcmp( p->portPath, registry[ p->usbIndex ].portPath ) == 0) {
+                rebindProbe( p );
+        }
     }
 
-    temperature = (buf[ 1 ] & 0xFF) + (buf[ 0 ] << 8);
-    temperature += 1152;                    // calibration value
-    *tempC = temperature * (125.0 / 32000.0);
-    
-    // printf( "............. %0.2f\n", *tempC );
-    return 0;
+    //
+    //  No registry (no sysfs?) - fall back to counting devices the old way
+    if (!p->t && registrySize == 0) {
+        p->t = TemperCreateFromDeviceNumber( p->usbIndex, USB_TIMEOUT, (debug ? 1 : 0 ) );
+        return (p->t != NULL);
+    }
+
+    if (!p->t) {
+        return FALSE;
+    }
+
+    //
+    //  Unregistered, its index would be whatever -p said and could be someone else's deviceNum
+    i = registryAdd( p->portPath );
+    if (i < 0) {
+        Logger_LogError( "Device registry [%s] is full and every port in it is in use - can't register port %s\n",
+                registryFile, p->portPath );
+        TemperFree( p->t );
+        p->t = NULL;
+        return FALSE;
+    }
+    p->usbIndex = i;
+
+    //
+    //  The example code always asked for this - we also compare it with what was on this
+    //  port last time, so a different device swapped onto a known port doesn't go unnoticed
+    entry = &registry[ i ];
+    memset( buf, 0, sizeof buf );
+    memset( identity, 0, sizeof identity );
+    length = TemperGetOtherStuff( p->t, buf, sizeof buf );
+    if (length > IDENTITY_BYTES) {
+        length = IDENTITY_BYTES;
+    }
+    for (j = 0; j < length; j += 1) {
+        snprintf( &identity[ j * 2 ], 3, "%02x", buf[ j ] & 0xFF );
+    }
+
+    if (length > 0 && strcmp( identity, entry->identity ) != 0) {
+        if (entry->identity[ 0 ] != '\0') {
+            Logger_LogWarning( "Device on port %s has changed (was %s, now %s) - readings stay with the port\n",
+                    p->portPath, entry->identity, identity );
+        }
+        strcpy( entry->identity, identity );
+        registrySave();
+    }
+
+    return TRUE;
 }
 
 // -----------------------------------------------------------------------------
-int TemperGetOtherStuff(Temper *t, char *buf, int length)
+static
+void    addProbe (char *spec)
 {
-    TemperSendCommand( t, 10, 11, 12, 13, 0, 0, 2, 0 );
-    TemperSendCommand( t, 0x52, 0, 0, 0, 0, 0, 0, 0 );
-    TemperSendCommand( t, 10, 11, 12, 13, 0, 0, 1, 0 );
-    return TemperGetData( t, buf, length );
-}
+    Probe   *p;
+    char    *colon;
+
+    if (numProbes >= MAX_PROBES) {
+        fprintf( stderr, "Too many probes - at most %d are supported\n", MAX_PROBES );
+        exit( 1 );
+    }
+
+    //
+    //  <registry index | port path>[:<location>] - an empty location means use the -l location.
+    //  Port paths always have a '-' in them ("2-1.3"), indexes never do.
+    p = &probes[ numProbes++ ];
+    memset( p, 0, sizeof *p );
+
+    colon = strchr( spec, ':' );
+    if (colon) {
+        strncpy( p->location, colon + 1, sizeof p->location - 1 );
+    }
 
+    if (memchr( spec, '-', colon ? (size_t) (colon - spec) : strlen( spec ) )) {
+        size_t  length = colon ? (size_t) (colon - spec) : strlen( spec );
+
+        if (length >= sizeof p->portPath) {
+            length = sizeof p->portPath - 1;
+        }
+        memcpy( p->portPath, spec, length );
+        p->pinned = TRUE;
+    } else {
+        p->usbIndex = atoi( spec );
+    }
+}
 
 // -----------------------------------------------------------------------------
 static
@@ -365,7 +1498,7 @@ void    parseCommandLine (int argc, char *argv[])
     int     ch;
     opterr = 0;
 
-    while (( (ch = getopt( argc, argv, "l:v:n:c:r:h:m:t:" )) != -1) && (ch != 255)) {
+    while (( (ch = getopt( argc, argv, "l:v:n:c:r:h:m:t:p:aSB:s:A:D:" )) != -1) && (ch != 255)) {
         switch (ch) {
             case 'c':   compensationDegreesF = (double) atof( optarg );
                         break;
@@ -385,6 +1518,27 @@ void    parseCommandLine (int argc, char *argv[])
                         break;
             case 'm':   mqttPort = atoi( optarg );
                         break;
+            case 'p':   addProbe( optarg );
+                        break;
+            case 'a':   publishAggregates = TRUE;
+                        break;
+            case 'S':   simulateDevices = TRUE;
+                        break;
+            case 'D':   strncpy( registryFile, optarg, sizeof registryFile - 1 );
+                        break;
+            case 'B':   benchmarkMessages = atoi( optarg );
+                        break;
+            case 's':   minReadSpacing = atoi( optarg ) / 1000.0;
+                        break;
+            case 'A':   if (sscanf( optarg, "%lf:%lf:%lf:%lf", &schedule.minInterval, &schedule.maxInterval,
+                                    &schedule.fastRate, &schedule.fastStddev ) < 2 ||
+                            schedule.minInterval <= 0.0 || schedule.maxInterval < schedule.minInterval ||
+                            schedule.fastRate <= 0.0 || schedule.fastStddev <= 0.0) {
+                            help();
+                            exit( 1 );
+                        }
+                        schedule.enabled = TRUE;
+                        break;
 
             default:    help();
                         exit( 1 );
@@ -393,15 +1547,354 @@ void    parseCommandLine (int argc, char *argv[])
     }
 }
 
+// --------------------------------------------------------------------------
+static
+void    readCycle (int scheduled)
+{
+    double  tempC = 0.0;
+    double  tempF = 0.0;
+    int     i;
+
+    for (i = 0; i < numProbes; i += 1) {
+        readProbeStarting( i );
+        if (TemperGetTemperatureInC( probes[ i ].t, &tempC ) < 0) {
+            //
+            //  Unplugged, replugged, hub reset... - reopen it by port and try once more
+            Logger_LogError( "TemperGetTemperatureInC failed for device %d - reopening\n", probes[ i ].usbIndex );
+            TemperFree( probes[ i ].t );
+            probes[ i ].t = NULL;
+
+            if (!openProbe( &probes[ i ] ) || TemperGetTemperatureInC( probes[ i ].t, &tempC ) < 0) {
+                Logger_LogFatal( "TemperGetTemperatureInC failed for device %d\n", probes[ i ].usbIndex );
+                exit( 1 );
+            }
+        }
+
+        //  Since I'm in the United States - lets convert to Fahrenheit too!
+        //      Tf = (9/5)*Tc+32; Tc = temperature in degrees Celsius, Tf = temperature in degrees Fahrenhei
+        tempF = (((9.0 / 5.0) * tempC) + 32.0);
+        tempF += compensationDegreesF;
+        bench.sampleTime = monotonicSeconds();
+
+        //MQTT_SendReceive( aMosquittoInstance );
+        mqttPublish( probes[ i ].id, probes[ i ].location, tempF );
+        aggregateAddSample( aggregateFind( probes[ i ].location ), tempF );
+    }
+
+    double now = monotonicSeconds();
+    bench.sampleTime = now;
+    for (i = 0; i < numAggregates; i += 1) {
+        aggregateFinishCycle( &aggregates[ i ], now, scheduled );
+        if (publishAggregates) {
+            mqttPublishAggregate( &aggregates[ i ] );
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+static
+int     compareDoubles (const void *a, const void *b)
+{
+    double  x = *(const double *) a;
+    double  y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+// --------------------------------------------------------------------------
+static
+double  percentile (double *sorted, long count, double pct)
+{
+    long    i;
+
+    if (count == 0) {
+        return 0.0;
+    }
+
+    i = (long) ((pct / 100.0) * (count - 1) + 0.5);
+    return sorted[ i ];
+}
+
+// --------------------------------------------------------------------------
+static
+double  cpuSeconds (void)
+{
+    struct rusage   usage;
+
+    getrusage( RUSAGE_SELF, &usage );
+    return usage.ru_utime.tv_sec + (usage.ru_utime.tv_usec / 1.0e6) +
+           usage.ru_stime.tv_sec + (usage.ru_stime.tv_usec / 1.0e6);
+}
+
+// --------------------------------------------------------------------------
+//
+//  One benchmark run: <cycles> back to back read cycles through the real publish path,
+//  then wait (a little) for the broker to echo everything back. Prints one JSON object.
+static
+void    benchmarkRun (int cycles, int withAggregates, int last)
+{
+    double  startWall, startCpu, elapsed, cpu;
+    double  drainStart, drain, deadline;
+    long    published, received, discarded, bytes, tagBytes;
+    int     i;
+
+    publishAggregates = withAggregates;
+
+    //
+    //  New run number - anything still in flight from the last run gets discarded
+    pthread_mutex_lock( &bench.lock );
+    bench.run += 1;
+    bench.published = 0;
+    bench.received = 0;
+    bench.discarded = 0;
+    bench.bytesOnWire = 0;
+    bench.tagBytes = 0;
+    pthread_mutex_unlock( &bench.lock );
+
+    //
+    //  Throughput and CPU cover the publish loop only - not the wait for stragglers
+    startWall = monotonicSeconds();
+    startCpu = cpuSeconds();
+    for (i = 0; i < cycles; i += 1) {
+        readCycle( TRUE );
+    }
+    elapsed = monotonicSeconds() - startWall;
+    cpu = cpuSeconds() - startCpu;
+
+    //
+    //  Give the broker up to 5 seconds to hand back the stragglers
+    drainStart = monotonicSeconds();
+    deadline = drainStart + 5.0;
+    for (;;) {
+        pthread_mutex_lock( &bench.lock );
+        received = bench.received;
+        published = bench.published;
+        pthread_mutex_unlock( &bench.lock );
+
+        if (received >= published || received >= bench.capacity || monotonicSeconds() > deadline) {
+            break;
+        }
+        struct timespec pause = { 0, 1000000 };
+        nanosleep( &pause, NULL );
+    }
+    drain = monotonicSeconds() - drainStart;
+
+    pthread_mutex_lock( &bench.lock );
+    published = bench.published;
+    received = bench.received;
+    discarded = bench.discarded;
+    bytes = bench.bytesOnWire;
+    tagBytes = bench.tagBytes;
+    qsort( bench.latency, received, sizeof( double ), compareDoubles );
+    pthread_mutex_unlock( &bench.lock );
+
+    printf( "    { \"format\":\"json\", \"aggregates\":%s, \"batch\":1, \"probes\":%d, \"cycles\":%d,"
+            " \"messages\":%ld, \"received\":%ld, \"discarded\":%ld, \"bytesOnWire\":%ld, \"benchTagBytes\":%ld, \"seconds\":%.6f,"
+            " \"drainSeconds\":%.6f, \"messagesPerSec\":%.1f, \"cpuMicrosPerMsg\":%.3f,"
+            " \"echoLatencyMs\":{ \"p50\":%.3f, \"p90\":%.3f, \"p99\":%.3f, \"p999\":%.3f, \"max\":%.3f } }%s\n",
+            withAggregates ? "true" : "false", numProbes, cycles,
+            published, received, discarded, bytes, tagBytes, elapsed, drain,
+            (elapsed > 0.0) ? published / elapsed : 0.0,
+            (published > 0) ? (cpu * 1.0e6) / published : 0.0,
+            percentile( bench.latency, received, 50.0 ) * 1000.0,
+            percentile( bench.latency, received, 90.0 ) * 1000.0,
+            percentile( bench.latency, received, 99.0 ) * 1000.0,
+            percentile( bench.latency, received, 99.9 ) * 1000.0,
+            percentile( bench.latency, received, 100.0 ) * 1000.0,
+            last ? "" : "," );
+}
+
+// --------------------------------------------------------------------------
+static
+void    runBenchmark (int cycles)
+{
+    double  deadline;
+    int     subacks = 0;
+
+    //
+    //  Worst case every cycle is one raw message per probe plus one aggregate per location
+    bench.capacity = (long) cycles * (numProbes + numAggregates);
+    bench.sentAt = calloc( bench.capacity, sizeof( double ) );
+    bench.latency = calloc( bench.capacity, sizeof( double ) );
+    if (!bench.sentAt || !bench.latency) {
+        Logger_LogFatal( "Benchmark - could not allocate room for %ld messages\n", bench.capacity );
+        exit( 1 );
+    }
+
+    //
+    //  Listen to our own topics, and let both subscriptions land before we start the clock
+    listenToOwnTopics = TRUE;
+    mqttStartListening();
+
+    deadline = monotonicSeconds() + 10.0;
+    while (subacks < 2 && monotonicSeconds() < deadline) {
+        struct timespec pause = { 0, 10000000 };
+
+        nanosleep( &pause, NULL );
+        pthread_mutex_lock( &requests.lock );
+        subacks = listenerSubacks;
+        pthread_mutex_unlock( &requests.lock );
+    }
+    if (subacks < 2) {
+        Logger_LogFatal( "Benchmark - the broker never acknowledged our subscriptions\n" );
+        exit( 1 );
+    }
+    bench.active = TRUE;
+
+    printf( "{ \"version\":\"%s\", \"broker\":\"%s:%d\", \"topic\":\"%s\","
+            " \"notes\":\"bytesOnWire is the untagged production size, benchTagBytes the benchmark tags on top"
+            " (messagesPerSec and cpuMicrosPerMsg include them);"
+            " echoLatencyMs is sample to echo at this client, a round trip through the broker\", \"runs\":[\n",
+            version, mqttHost, mqttPort, mqttTopic );
+    benchmarkRun( cycles, FALSE, FALSE );
+    benchmarkRun( cycles, TRUE, TRUE );
+    printf( "] }\n" );
+    fflush( stdout );
+
+    bench.active = FALSE;
+    mqttStopListening();
+    free( bench.sentAt );
+    free( bench.latency );
+}
+
+// --------------------------------------------------------------------------
+//
+//  Sleep until the next scheduled read or until someone asks for one - whichever comes
+//  first - but never start an on demand read within minReadSpacing of the last one.
+//  Returns TRUE when it's the scheduled read that's due.
+static
+int     waitForNextRead (double nextScheduled)
+{
+    struct timespec wake;
+    double          now, wakeAt, earliest;
+    int             scheduled = FALSE;
+
+    pthread_mutex_lock( &requests.lock );
+    for (;;) {
+        now = monotonicSeconds();
+        if (now >= nextScheduled) {
+            scheduled = TRUE;
+            break;
+        }
+
+        wakeAt = nextScheduled;
+        if (requests.pending) {
+            earliest = requests.lastReadTime + minReadSpacing;
+            if (now >= earliest) {
+                break;
+            }
+            wakeAt = earliest;
+        }
+
+        wake.tv_sec = (time_t) wakeAt;
+        wake.tv_nsec = (long) ((wakeAt - wake.tv_sec) * 1.0e9);
+        pthread_cond_timedwait( &requests.cond, &requests.lock, &wake );
+    }
+
+    requests.pending = FALSE;
+    requests.inFlight = TRUE;
+    memset( requests.sampled, 0, sizeof requests.sampled );
+    pthread_mutex_unlock( &requests.lock );
+    return scheduled;
+}
+
+// --------------------------------------------------------------------------
+//
+//  How long to wait before the next scheduled read. Fixed at tempReadInterval unless -A
+//  was given, in which case it follows the fastest moving location.
+static
+double  nextReadInterval (double now)
+{
+    double  rate = 0.0;
+    double  stddev = 0.0;
+    double  previous;
+    int     i;
+
+    if (!schedule.enabled) {
+        return tempReadInterval;
+    }
+
+    for (i = 0; i < numAggregates; i += 1) {
+        if (fabs( aggregates[ i ].ratePerMin ) > rate) {
+            rate = fabs( aggregates[ i ].ratePerMin );
+        }
+        if (aggregateTrendStddev( &aggregates[ i ] ) > stddev) {
+            stddev = aggregateTrendStddev( &aggregates[ i ] );
+        }
+    }
+
+    previous = schedule.interval;
+    if (rate >= schedule.fastRate || stddev >= schedule.fastStddev) {
+        schedule.interval /= 2.0;
+        schedule.calmSince = 0.0;
+    } else if (rate <= schedule.fastRate * ADAPT_CALM_FRACTION && stddev <= schedule.fastStddev * ADAPT_CALM_FRACTION) {
+        if (schedule.calmSince == 0.0) {
+            schedule.calmSince = now;
+        } else if (now - schedule.calmSince >= ADAPT_CALM_SECONDS) {
+            schedule.interval *= ADAPT_BACKOFF;
+            schedule.calmSince = now;
+        }
+    } else {
+        schedule.calmSince = 0.0;           // in between - hold where we are
+    }
+
+    if (schedule.interval < schedule.minInterval) {
+        schedule.interval = schedule.minInterval;
+    }
+    if (schedule.interval > schedule.maxInterval) {
+        schedule.interval = schedule.maxInterval;
+    }
+
+    if (schedule.interval != previous) {
+        Logger_LogInfo( "Read interval now %.1f seconds (rate %.3f F/min, stddev %.2f F)\n", schedule.interval, rate, stddev );
+    }
+    return schedule.interval;
+}
+
+// --------------------------------------------------------------------------
+static
+void    readFinished (void)
+{
+    pthread_mutex_lock( &requests.lock );
+    requests.inFlight = FALSE;
+    requests.lastReadTime = monotonicSeconds();
+    pthread_mutex_unlock( &requests.lock );
+}
+
+
+
+// --------------------------------------------------------------------------
+//
+//  Every probe listens on <topic>/<deviceNum>/read, but a request on any of them reads
+//  all the probes: the per location aggregates (spread in particular) only make sense
+//  when every probe in the location is read in the same cycle.
+static
+void    subscribeReadTopics (void)
+{
+    pthread_condattr_t  attr;
+    int                 i;
+
+    //
+    //  waitForNextRead works in monotonic time - so must the condition variable
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( &requests.cond, &attr );
+    pthread_condattr_destroy( &attr );
+
+    for (i = 0; i < numProbes; i += 1) {
+        snprintf( probes[ i ].readTopic, sizeof probes[ i ].readTopic, "%s/%d/read", mqttTopic, probes[ i ].id );
+    }
+
+    mqttStartListening();
+}
+
 // --------------------------------------------------------------------------
 int main(int argc, char** argv)
 {
     int                 done = FALSE;
-    double              tempC = 0.0;
-    double              tempF = 0.0;
-    Temper              *t = NULL;
-    char                buf[ 256 ];
-    int                 ret;
+    int                 scheduled;
+    double              now, nextScheduled;
+    int                 i;
 
     //
     // Initialize values to some common, sensible defaults.
@@ -409,8 +1902,28 @@ int main(int argc, char** argv)
     strncpy( location , "RV", sizeof location );
     deviceNum = 1;
     
-    printf( "TemperUSB Reader Version %s\n", version );
     parseCommandLine( argc, argv );
+
+    //
+    //  Benchmark results go to stdout as JSON - keep the banner out of the way
+    if (benchmarkMessages == 0) {
+        printf( "TemperUSB Reader Version %s\n", version );
+    }
+
+    //
+    //  No -p options - just the first device, as it always was
+    if (numProbes == 0) {
+        addProbe( "0" );
+    }
+
+    for (i = 0; i < numProbes; i += 1) {
+        if (probes[ i ].location[ 0 ] == '\0') {
+            strncpy( probes[ i ].location, location, sizeof probes[ i ].location - 1 );
+        }
+
+        LocationAgg *agg = aggregateFind( probes[ i ].location );
+        agg->numProbes += 1;
+    }
     
     Logger_Initialize( "/tmp/temperusb.log", debugValue );
     Logger_LogWarning( "%s\n", version );
@@ -457,39 +1970,58 @@ int main(int argc, char** argv)
     usb_find_busses();
     usb_find_devices();
 
-    t = TemperCreateFromDeviceNumber( 0, USB_TIMEOUT, (debug ? 1 : 0 ) );
-    if (!t) {
-        Logger_LogFatal( "TemperCreateFromDeviceNumber failed\n" );
-        exit( -1 );
+    if (!simulateDevices) {
+        registryLoad();
+    }
+
+    for (i = 0; i < numProbes; i += 1) {
+        if (!openProbe( &probes[ i ] )) {
+            Logger_LogFatal( "Could not open TemperUSB device %s%s\n",
+                    probes[ i ].portPath[ 0 ] ? "on port " : "", probes[ i ].portPath[ 0 ] ? probes[ i ].portPath : "" );
+            exit( -1 );
+        }
+
+        //
+        //  Registered index, so the same physical device keeps the same deviceNum
+        probes[ i ].id = deviceNum + probes[ i ].usbIndex;
     }
 
 
+    if (benchmarkMessages > 0) {
+        runBenchmark( benchmarkMessages );
+        MQTT_Teardown( aMosquittoInstance, NULL );
+        Logger_Terminate();
+        return EXIT_SUCCESS;
+    }
+
     //
-    //  I doubt this is necessary but it was in the example code
-    memset( buf, 0, 256 );
-    ret = TemperGetOtherStuff( t, buf, 256 );
+    //  Adaptive reads start out at the -r interval, pulled into the -A bounds
+    schedule.interval = tempReadInterval;
+    if (schedule.interval < schedule.minInterval) {
+        schedule.interval = schedule.minInterval;
+    }
+    if (schedule.interval > schedule.maxInterval) {
+        schedule.interval = schedule.maxInterval;
+    }
 
+    subscribeReadTopics();
 
     //
-    //  Now loop forever reading temps from the device
+    //  Now loop forever reading temps from the devices
+    //
+    //  On demand reads slot in between scheduled ones without moving the schedule
+    scheduled = TRUE;
     while (!done) {
-
-        if (TemperGetTemperatureInC( t, &tempC ) < 0) {
-            Logger_LogFatal( "TemperGetTemperatureInC failed\n" );
-            exit( 1 );
+        readCycle( scheduled );
+        readFinished();
+        if (scheduled) {
+            now = monotonicSeconds();
+            nextScheduled = now + nextReadInterval( now );
         }
-
-        //  Since I'm in the United States - lets convert to Fahrenheit too!
-        //      Tf = (9/5)*Tc+32; Tc = temperature in degrees Celsius, Tf = temperature in degrees Fahrenhei
-        tempF = (((9.0 / 5.0) * tempC) + 32.0);
-        tempF += compensationDegreesF;
-
-        //MQTT_SendReceive( aMosquittoInstance );
-        mqttPublish( tempF );
-
-        sleep( tempReadInterval );
+        scheduled = waitForNextRead( nextScheduled );
     }       // while !done
 
+    mqttStopListening();
     MQTT_Teardown( aMosquittoInstance, mqttTopic );
     Logger_Terminate();
 
@@ -60,7 +60,7 @@ LDLIBSOPTIONS=
 
 ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/temperusb_c: ${OBJECTFILES}
 	${MKDIR} -p ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}
-	${LINK.c} -o ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/temperusb_c ${OBJECTFILES} ${LDLIBSOPTIONS} -lusb -llog4c -llibmqttrv -lmosquitto -lavahi-client -lavahi-common
+	${LINK.c} -o ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/temperusb_c ${OBJECTFILES} ${LDLIBSOPTIONS} -lusb -llog4c -llibmqttrv -lmosquitto -lavahi-client -lavahi-common -lm -lpthread
 
 ${OBJECTDIR}/main.o: main.c
 	${MKDIR} -p ${OBJECTDIR}
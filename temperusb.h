@@ -40,9 +40,12 @@ extern "C" {
  */
 
 typedef struct Temper Temper;
+struct usb_device;
 
 
 Temper *TemperCreateFromDeviceNumber(int deviceNum, int timeout, int debug);
+Temper *TemperCreateFromPortPath(char *portPath, int timeout, int debug);
+int TemperGetPortPath(struct usb_device *dev, char *portPath, int length);
 void TemperFree(Temper *t);
 int TemperGetTemperatureInC(Temper *t, double *tempC);
 int TempterGetOtherStuff(Temper *t, char *buf, int length);